@@ -0,0 +1,40 @@
+#!/bin/sh
+# Run a command natively if the host CPU has the ISA extensions that
+# Stockfish ARCH=x86-64-avx512icl uses, and under Intel SDE ($SDE_PATH)
+# otherwise. The emulated and the native runs execute the same code, so the
+# profiles written by a PGO-instrumented binary have the same counts either way.
+# Usage: run-avx512.sh [--] command [args...]
+# Set FORCE_SDE=1 to always use SDE. The Dockerfile test stage only uses this
+# script with --build-arg PGO_NATIVE=1.
+# There is no region-sampled mode: under SDE every instruction runs in the
+# emulator whatever the controller does, and a profile of sampled regions
+# would only hold partial branch weights.
+
+set -e
+
+if [ "$1" = "--" ]; then
+    shift
+fi
+
+FEATURES="avx512f avx512bw avx512vl avx512dq avx512cd avx512_vnni avx512ifma avx512vbmi
+          avx512_vbmi2 avx512_vpopcntdq avx512_bitalg gfni vaes vpclmulqdq bmi2 popcnt"
+
+native=1
+if [ "${FORCE_SDE:-0}" = "1" ]; then
+    native=0
+else
+    flags=" $(grep -m1 '^flags' /proc/cpuinfo 2>/dev/null | cut -d: -f2) "
+    for feature in $FEATURES; do
+        case "$flags" in
+            *" $feature "*) ;;
+            *) native=0; break ;;
+        esac
+    done
+fi
+
+if [ "$native" = "1" ]; then
+    exec "$@"
+fi
+# SDE_PATH holds the loader and the sde64 command line, split on purpose
+# shellcheck disable=SC2086
+exec $SDE_PATH -- "$@"
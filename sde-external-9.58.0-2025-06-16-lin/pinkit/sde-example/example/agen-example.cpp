@@ -13,22 +13,37 @@ extern "C"
 #include <fstream>
 #include "sde-init.H"
 #include "sde-emulating.H"
+#include "agen_capture.H"
 
 using namespace std;
 
 static KNOB<string> knob_out(KNOB_MODE_WRITEONCE, "pintool", "oagen", "agen-example.out",
                              "specify output file name");
+static KNOB<string> knob_capture(KNOB_MODE_WRITEONCE, "pintool", "agen-capture", "",
+                                 "capture the element addresses of gathers and scatters "
+                                 "into the specified binary file");
+static KNOB<UINT32> knob_capture_buffer(KNOB_MODE_WRITEONCE, "pintool", "agen-capture-buffer",
+                                        "65536", "records buffered per thread by -agen-capture");
+static KNOB<BOOL> knob_capture_compress(KNOB_MODE_WRITEONCE, "pintool", "agen-capture-compress",
+                                        "0", "compress -agen-capture on a writer thread");
+
+// per-thread counters, one cache line per thread to avoid false sharing
+struct alignas(64) THREAD_STATS
+{
+    UINT64 read_count;
+    UINT64 write_count;
+    UINT64 agen_count;
+    UINT64 ins_count;
+    UINT64 agen_icount;
+    UINT64 emu_icount;
+};
 
-static UINT64 read_count  = 0;
-static UINT64 write_count = 0;
-static UINT64 agen_count  = 0;
-static UINT64 ins_count   = 0;
-static UINT64 agen_icount = 0;
-static UINT64 emu_icount  = 0;
+static THREAD_STATS stats[PIN_MAX_THREADS];
+static AGEN_CAPTURE* capture = 0;
 
-VOID mem_read(THREADID tid, ADDRINT addr, UINT32 size) { read_count += size; }
+VOID mem_read(THREADID tid, ADDRINT addr, UINT32 size) { stats[tid].read_count += size; }
 
-VOID mem_write(THREADID tid, ADDRINT addr, UINT32 size) { write_count += size; }
+VOID mem_write(THREADID tid, ADDRINT addr, UINT32 size) { stats[tid].write_count += size; }
 
 VOID mem_agen(THREADID tid)
 {
@@ -36,8 +51,7 @@ VOID mem_agen(THREADID tid)
     if (!sde_agen_init(tid, &nrefs))
         return;
 
-    agen_icount++;
-    double v;
+    stats[tid].agen_icount++;
     for (i = 0; i < nrefs; i++)
     {
         sde_memop_info_t meminfo;
@@ -46,15 +60,13 @@ VOID mem_agen(THREADID tid)
             mem_read(tid, meminfo.memea, meminfo.bytes_per_ref);
         else
             mem_write(tid, meminfo.memea, meminfo.bytes_per_ref);
-        agen_count += meminfo.bytes_per_ref;
-        PIN_SafeCopy((void*)&v, (void*)meminfo.memea, meminfo.bytes_per_ref);
-        std::cout << v << endl;
+        stats[tid].agen_count += meminfo.bytes_per_ref;
     }
 }
 
-VOID icount(THREADID tid, UINT32 inss) { ins_count += inss; }
+VOID icount(THREADID tid, UINT32 inss) { stats[tid].ins_count += inss; }
 
-VOID emu_count(THREADID tid, UINT32 inss) { emu_icount += inss; }
+VOID emu_count(THREADID tid, UINT32 inss) { stats[tid].emu_icount += inss; }
 
 VOID instrument_trace(TRACE trace, VOID* v)
 {
@@ -78,9 +90,12 @@ VOID instrument_trace(TRACE trace, VOID* v)
 
             if (agen_attr)
             {
+                if (capture)
+                    capture->InstrumentIns(ins);
+
                 if (xed_decoded_inst_get_category(xedd) == XED_CATEGORY_GATHER)
                 {
-                    /* dump only gather instructions */
+                    /* count only gather instructions */
                     INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)mem_agen, IARG_THREAD_ID,
                                    IARG_END);
                 }
@@ -115,6 +130,18 @@ VOID instrument_trace(TRACE trace, VOID* v)
 
 VOID fini(int code, VOID* v)
 {
+    UINT64 read_count = 0, write_count = 0, agen_count = 0;
+    UINT64 ins_count = 0, agen_icount = 0, emu_icount = 0;
+    for (UINT32 tid = 0; tid < PIN_MAX_THREADS; tid++)
+    {
+        read_count += stats[tid].read_count;
+        write_count += stats[tid].write_count;
+        agen_count += stats[tid].agen_count;
+        ins_count += stats[tid].ins_count;
+        agen_icount += stats[tid].agen_icount;
+        emu_icount += stats[tid].emu_icount;
+    }
+
     double read_avg  = (double)read_count / ins_count;
     double write_avg = (double)write_count / ins_count;
     double agen_avg  = 0;
@@ -134,6 +161,9 @@ VOID fini(int code, VOID* v)
     out << "Total agen: " << agen_count << " bytes " << agen_avg
         << " bytes per agen instruction " << endl;
     out << "Total emulated instructions: " << emu_icount << endl;
+    if (capture)
+        out << "Captured agen instructions: " << capture->Instructions()
+            << " elements: " << capture->Elements() << endl;
     out.close();
 }
 
@@ -145,6 +175,18 @@ int main(int argc, char* argv[])
     sde_pin_init(argc, argv);
     sde_init();
 
+    if (!knob_capture.Value().empty())
+    {
+        capture = new AGEN_CAPTURE(knob_capture.Value(), knob_capture_buffer.Value(),
+                                   AGEN_CAPTURE_GATHER | AGEN_CAPTURE_SCATTER,
+                                   knob_capture_compress.Value());
+        if (!capture->Activate())
+        {
+            cerr << "Cannot open " << knob_capture.Value() << endl;
+            return 1;
+        }
+    }
+
     // register Trace to be called to instrument instructions
     TRACE_AddInstrumentFunction(instrument_trace, 0);
 
@@ -16,6 +16,7 @@
 // for requesting a pointer to the SDE's controller
 #include "sde-control.H"
 #include "pcregions_control.H"
+#include "fork_checkpoint.H"
 
 // This tool demonstrates how to register a handler for various
 // events reported by SDE's controller module.
@@ -28,6 +29,11 @@
 // A global (all threads) count of the monitored PCs is output on
 // certain events.
 
+// Optional feature:
+// Fork many runs of the rest of the program at a checkpoint event of the
+// controller, e.g. -control checkpoint:icount:<n> -checkpoint_runs 8.
+// When the logger is active, each run logs its own pinball.
+
 #if defined(PINPLAY)
 #include "sde-pinplay-supp.H"
 using namespace INSTLIB;
@@ -39,6 +45,10 @@ KNOB<UINT64> KnobWStartPC(KNOB_MODE_WRITEONCE, "pintool", "wstart_pc", "0", "War
 KNOB<UINT64> KnobSStartPC(KNOB_MODE_WRITEONCE, "pintool", "sstart_pc", "0",
                           "Simulation start PC");
 KNOB<UINT64> KnobSEndPC(KNOB_MODE_WRITEONCE, "pintool", "send_pc", "0", "Simulation end PC");
+KNOB<UINT32> KnobCheckpointRuns(KNOB_MODE_WRITEONCE, "pintool", "checkpoint_runs", "0",
+                                "Runs forked at the checkpoint controller event");
+KNOB<UINT32> KnobCheckpointJobs(KNOB_MODE_WRITEONCE, "pintool", "checkpoint_jobs", "1",
+                                "Checkpoint runs executing at once");
 
 using namespace CONTROLLER;
 
@@ -69,6 +79,8 @@ KNOB_COMMENT pcregion_knob_family("pintool:pcregions_control", "PC regions contr
 CONTROL_ARGS args("", "pintool:pcregions_control");
 CONTROL_PCREGIONS pcregions(args, sde_control);
 
+static FORK_CHECKPOINT* checkpoint = 0;
+
 VOID Handler(EVENT_TYPE ev, VOID* v, CONTEXT* ctxt, VOID* ip, THREADID tid, BOOL bcast)
 {
     PIN_GetLock(&output_lock, tid + 1);
@@ -130,6 +142,19 @@ VOID Handler(EVENT_TYPE ev, VOID* v, CONTEXT* ctxt, VOID* ip, THREADID tid, BOOL
     PIN_ReleaseLock(&output_lock);
 }
 
+// called in each run forked at the checkpoint
+VOID CheckpointRun(UINT32 run, VOID* v)
+{
+    std::cerr << "Checkpoint run " << dec << run << " pid " << PIN_GetPid()
+              << " global_ins_count " << global_ins_counter._count << endl;
+#if defined(PINPLAY)
+    PINPLAY_ENGINE* pinplay_engine = sde_tracing_get_pinplay_engine();
+    if (pinplay_engine && pinplay_engine->IsLoggerActive())
+        pinplay_engine->LoggerSetBaseName(pinplay_engine->LoggerGetBaseName() +
+                                          checkpoint->RunSuffix());
+#endif
+}
+
 // increment counter for the PCTYPE 'pct'
 VOID Countaddr(UINT32 pct, THREADID tid)
 {
@@ -197,6 +222,11 @@ int main(int argc, char* argv[])
     //Register handler on SDE's controller, must be done before PIN_StartProgram
     sde_control->RegisterHandler(Handler, 0, 0);
 
+    checkpoint = new FORK_CHECKPOINT(sde_control, KnobCheckpointRuns.Value(),
+                                     KnobCheckpointJobs.Value());
+    checkpoint->AddRunCallback(CheckpointRun, 0);
+    checkpoint->Activate();
+
     sde_init();
 
     control_tid = KnobControlThread.Value();
@@ -6,7 +6,9 @@
 // Simple example program to read a DCFG and print some statistics.
 
 #include "dcfg_api.H"
+#include "dcfg_bin_api.H"
 #include "dcfg_trace_api.H"
+#include "dcfg_trace_stream_api.H"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -14,16 +16,19 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <algorithm>
 
 using namespace std;
 using namespace dcfg_api;
 using namespace dcfg_trace_api;
+using namespace dcfg_bin_api;
 
 char* inner_loops_file  = NULL;
 char* source_loops_file = NULL;
 char* dcfg_file         = NULL;
 char* edge_file         = NULL;
+char* binary_file       = NULL;
 
 // Class to collect and print some simple statistics.
 class Stats
@@ -61,6 +66,29 @@ class Stats
     }
 };
 
+// Counts for one loop, as written to the loop statistics files.
+struct LoopSummary
+{
+    UINT64 numInstrs, numDynamicInstrs, numVisits;
+};
+
+LoopSummary summarizeLoop(DCFG_PROCESS_CPTR pinfo, DCFG_LOOP_CPTR linfo)
+{
+    LoopSummary ls = {0, 0, 0};
+    DCFG_ID_VECTOR loopBbs, entryEdgeIds;
+    linfo->get_basic_block_ids(loopBbs);
+    linfo->get_entry_edge_ids(entryEdgeIds);
+    for (size_t bi = 0; bi < loopBbs.size(); bi++)
+    {
+        DCFG_BASIC_BLOCK_CPTR bbData = pinfo->get_basic_block_info(loopBbs[bi]);
+        ls.numInstrs += bbData->get_num_instrs();
+        ls.numDynamicInstrs += bbData->get_instr_count();
+    }
+    for (size_t ei = 0; ei < entryEdgeIds.size(); ei++)
+        ls.numVisits += pinfo->get_edge_info(entryEdgeIds[ei])->get_exec_count();
+    return ls;
+}
+
 // Summarize DCFG contents.
 void summarizeDcfg(DCFG_DATA_CPTR dcfg)
 {
@@ -119,7 +147,18 @@ void summarizeDcfg(DCFG_DATA_CPTR dcfg)
                    "#iterations,#static-instrs,#dynamic-instructions"
                 << endl;
         }
+        if (inner_loops_file)
+        {
+            os.open(inner_loops_file, ios_base::out);
+            if (!os.is_open())
+            {
+                cerr << "Error: cannot open '" << inner_loops_file
+                     << "' for saving inner source loop statistics." << endl;
+                return;
+            }
+        }
 
+        bool first = true; // header of the inner loops stats not yet written
         for (size_t ii = 0; ii < image_ids.size(); ii++)
         {
             DCFG_IMAGE_CPTR iinfo = pinfo->get_image_info(image_ids[ii]);
@@ -130,7 +169,6 @@ void summarizeDcfg(DCFG_DATA_CPTR dcfg)
             iinfo->get_basic_block_ids(bb_ids);
             iinfo->get_routine_ids(routine_ids);
             iinfo->get_loop_ids(loop_ids);
-            iinfo->get_loop_ids(inner_loop_ids);
 
             cout << "  Image , " << image_ids[ii] << endl;
             cout << "   Load addr        , 0x" << hex << iinfo->get_base_address() << dec
@@ -167,160 +205,87 @@ void summarizeDcfg(DCFG_DATA_CPTR dcfg)
             // Loops.
             loopStats.addVal(loop_ids.size());
             unsigned int no_source_loops = 0;
+            DCFG_ID_VECTOR parent_ids;
             for (size_t li = 0; li < loop_ids.size(); li++)
             {
-                DCFG_LOOP_CPTR linfo = iinfo->get_loop_info(loop_ids[li]);
+                DCFG_ID loopId       = loop_ids[li];
+                DCFG_LOOP_CPTR linfo = iinfo->get_loop_info(loopId);
                 assert(linfo);
                 if (linfo->get_parent_loop_id())
-                {
-                    // Any loop that is a parent cannot be an inner loop
-                    inner_loop_ids.erase(std::remove(inner_loop_ids.begin(),
-                                                     inner_loop_ids.end(),
-                                                     linfo->get_parent_loop_id()),
-                                         inner_loop_ids.end());
-                }
+                    parent_ids.push_back(linfo->get_parent_loop_id());
                 loopTripStats.addVal(linfo->get_iteration_count());
-                if (source_loops_file)
+                if (!source_loops_file)
+                    continue;
+                DCFG_BASIC_BLOCK_CPTR loopIdData = pinfo->get_basic_block_info(loopId);
+                if (loopIdData->get_source_filename() && loopIdData->get_exec_count())
                 {
-                    DCFG_ID loopId = loop_ids[li];
-                    DCFG_ID_VECTOR loopBbs;
-                    DCFG_BASIC_BLOCK_CPTR loopIdData = pinfo->get_basic_block_info(loopId);
-                    DCFG_ID_VECTOR entryEdgeIds;
-                    linfo->get_entry_edge_ids(entryEdgeIds);
-                    linfo->get_basic_block_ids(loopBbs);
-                    if (loopIdData->get_source_filename() && loopIdData->get_exec_count())
-                    {
-                        no_source_loops++;
-                        UINT64 num_instrs         = 0;
-                        UINT64 num_dynamic_instrs = 0;
-                        UINT64 num_visits         = 0;
-                        for (size_t bi = 0; bi < loopBbs.size(); bi++)
-                        {
-                            DCFG_ID bbId                 = loopBbs[bi];
-                            DCFG_BASIC_BLOCK_CPTR bbData = pinfo->get_basic_block_info(bbId);
-                            num_instrs += bbData->get_num_instrs();
-                            num_dynamic_instrs += bbData->get_instr_count();
-                        }
-                        for (size_t ei = 0; ei < entryEdgeIds.size(); ei++)
-                        {
-                            DCFG_ID entryEdgeId          = entryEdgeIds[ei];
-                            DCFG_EDGE_CPTR entryEdgeData = pinfo->get_edge_info(entryEdgeId);
-                            num_visits += entryEdgeData->get_exec_count();
-                        }
-                        if (num_visits)
-                            sos << dec << loopId << "," << *(loopIdData->get_source_filename())
-                                << ":" << loopIdData->get_source_line_number() << ","
-                                << num_visits << "," << loopIdData->get_exec_count() << ","
-                                << num_instrs << "," << num_dynamic_instrs << endl;
-                        else
-                            sos << dec << loopId << "," << *(loopIdData->get_source_filename())
-                                << ":" << loopIdData->get_source_line_number() << ","
-                                << "*NA*"
-                                << "," << loopIdData->get_exec_count() << "," << num_instrs
-                                << "," << num_dynamic_instrs << endl;
-                    }
+                    no_source_loops++;
+                    LoopSummary ls = summarizeLoop(pinfo, linfo);
+                    sos << dec << loopId << "," << *(loopIdData->get_source_filename()) << ":"
+                        << loopIdData->get_source_line_number() << ",";
+                    if (ls.numVisits)
+                        sos << ls.numVisits;
+                    else
+                        sos << "*NA*";
+                    sos << "," << loopIdData->get_exec_count() << "," << ls.numInstrs << ","
+                        << ls.numDynamicInstrs << endl;
                 }
             }
+
+            // Any loop that is a parent cannot be an inner loop.
+            sort(parent_ids.begin(), parent_ids.end());
+            for (size_t li = 0; li < loop_ids.size(); li++)
+            {
+                if (!binary_search(parent_ids.begin(), parent_ids.end(), loop_ids[li]))
+                    inner_loop_ids.push_back(loop_ids[li]);
+            }
             cout << "   Num inner-most loops        , " << inner_loop_ids.size() << endl;
             cout << "   Num source loops        , " << no_source_loops << endl;
-            if (inner_loops_file)
+            if (!inner_loops_file)
+                continue;
+
+            // Inner loops: each one with its enclosing loops.
+            for (size_t li = 0; li < inner_loop_ids.size(); li++)
             {
-                bool first = true;
-                os.open(inner_loops_file, ios_base::out);
-                if (!os.is_open())
+                DCFG_ID loopId                   = inner_loop_ids[li];
+                DCFG_LOOP_CPTR linfo             = iinfo->get_loop_info(loopId);
+                DCFG_BASIC_BLOCK_CPTR loopIdData = pinfo->get_basic_block_info(loopId);
+                assert(linfo);
+                if (!loopIdData->get_source_filename() || !loopIdData->get_exec_count())
+                    continue;
+
+                UINT32 nesting    = 0;
+                DCFG_ID parent_id = linfo->get_parent_loop_id();
+                while (parent_id)
                 {
-                    cerr << "Error: cannot open '" << inner_loops_file
-                         << "' for saving inner source loop statistics." << endl;
-                    return;
+                    nesting++;
+                    parent_id = iinfo->get_loop_info(parent_id)->get_parent_loop_id();
                 }
 
-                for (size_t li = 0; li < inner_loop_ids.size(); li++)
+                if (first)
                 {
-                    DCFG_LOOP_CPTR linfo = iinfo->get_loop_info(inner_loop_ids[li]);
-                    assert(linfo);
-                    DCFG_ID loopId = inner_loop_ids[li];
-                    DCFG_ID_VECTOR loopBbs;
-                    DCFG_BASIC_BLOCK_CPTR loopIdData = pinfo->get_basic_block_info(loopId);
-                    DCFG_ID_VECTOR entryEdgeIds;
-                    linfo->get_entry_edge_ids(entryEdgeIds);
-                    linfo->get_basic_block_ids(loopBbs);
-                    if (loopIdData->get_source_filename() && loopIdData->get_exec_count())
+                    first = false;
+                    os << "nesting-depth,filename:linenumber,#visits, "
+                          "#iterations,#static-instrs,#dynamic-instructions"
+                       << endl;
+                }
+                parent_id = loopId;
+                while (parent_id)
+                {
+                    DCFG_LOOP_CPTR plinfo             = iinfo->get_loop_info(parent_id);
+                    DCFG_BASIC_BLOCK_CPTR ploopIdData = pinfo->get_basic_block_info(parent_id);
+                    if (ploopIdData->get_source_filename() && ploopIdData->get_exec_count())
                     {
-                        UINT64 num_instrs         = 0;
-                        UINT64 num_dynamic_instrs = 0;
-                        UINT64 num_visits         = 0;
-                        for (size_t bi = 0; bi < loopBbs.size(); bi++)
-                        {
-                            DCFG_ID bbId                 = loopBbs[bi];
-                            DCFG_BASIC_BLOCK_CPTR bbData = pinfo->get_basic_block_info(bbId);
-                            num_instrs += bbData->get_num_instrs();
-                            num_dynamic_instrs += bbData->get_instr_count();
-                        }
-                        for (size_t ei = 0; ei < entryEdgeIds.size(); ei++)
-                        {
-                            DCFG_ID entryEdgeId          = entryEdgeIds[ei];
-                            DCFG_EDGE_CPTR entryEdgeData = pinfo->get_edge_info(entryEdgeId);
-                            num_visits += entryEdgeData->get_exec_count();
-                        }
-                        UINT32 nesting    = 0;
-                        DCFG_ID parent_id = linfo->get_parent_loop_id();
-                        while (parent_id)
-                        {
-                            DCFG_LOOP_CPTR plinfo = iinfo->get_loop_info(parent_id);
-                            nesting++;
-                            parent_id = plinfo->get_parent_loop_id();
-                        }
-
-                        if (first)
-                        {
-                            first = false;
-                            os << "nesting-depth,filename:linenumber,#visits, "
-                                  "#iterations,#static-instrs,#dynamic-instructions"
-                               << endl;
-                        }
-                        parent_id = loopId;
-                        while (parent_id)
-                        {
-                            DCFG_LOOP_CPTR plinfo = iinfo->get_loop_info(parent_id);
-                            DCFG_BASIC_BLOCK_CPTR ploopIdData =
-                                pinfo->get_basic_block_info(parent_id);
-                            DCFG_ID_VECTOR loopBbs;
-                            DCFG_ID_VECTOR entryEdgeIds;
-                            plinfo->get_entry_edge_ids(entryEdgeIds);
-                            plinfo->get_basic_block_ids(loopBbs);
-                            if (ploopIdData->get_source_filename() &&
-                                ploopIdData->get_exec_count())
-                            {
-                                UINT64 num_instrs         = 0;
-                                UINT64 num_dynamic_instrs = 0;
-                                UINT64 num_visits         = 0;
-                                for (size_t bi = 0; bi < loopBbs.size(); bi++)
-                                {
-                                    DCFG_ID bbId = loopBbs[bi];
-                                    DCFG_BASIC_BLOCK_CPTR bbData =
-                                        pinfo->get_basic_block_info(bbId);
-                                    num_instrs += bbData->get_num_instrs();
-                                    num_dynamic_instrs += bbData->get_instr_count();
-                                }
-                                for (size_t ei = 0; ei < entryEdgeIds.size(); ei++)
-                                {
-                                    DCFG_ID entryEdgeId = entryEdgeIds[ei];
-                                    DCFG_EDGE_CPTR entryEdgeData =
-                                        pinfo->get_edge_info(entryEdgeId);
-                                    num_visits += entryEdgeData->get_exec_count();
-                                }
-                                os << dec << nesting << ","
-                                   << *(ploopIdData->get_source_filename()) << ":"
-                                   << ploopIdData->get_source_line_number() << ","
-                                   << num_visits << "," << ploopIdData->get_exec_count() << ","
-                                   << num_instrs << "," << num_dynamic_instrs << endl;
-                            }
-                            nesting--;
-                            parent_id = plinfo->get_parent_loop_id();
-                        }
-                        os << endl;
+                        LoopSummary ls = summarizeLoop(pinfo, plinfo);
+                        os << dec << nesting << "," << *(ploopIdData->get_source_filename())
+                           << ":" << ploopIdData->get_source_line_number() << ","
+                           << ls.numVisits << "," << ploopIdData->get_exec_count() << ","
+                           << ls.numInstrs << "," << ls.numDynamicInstrs << endl;
                     }
+                    nesting--;
+                    parent_id = plinfo->get_parent_loop_id();
                 }
+                os << endl;
             }
         }
 
@@ -354,7 +319,8 @@ void summarizeTrace(DCFG_DATA_CPTR dcfg, string tracefile)
         assert(pinfo);
 
         // Make a new reader.
-        DCFG_TRACE_READER* traceReader = DCFG_TRACE_READER::new_reader(pid);
+        // The trace is streamed through fixed-size windows, so it need not fit in memory.
+        DCFG_TRACE_STREAM_READER traceReader(pid);
 
         // threads.
         for (UINT32 tid = 0; tid <= pinfo->get_highest_thread_id(); tid++)
@@ -363,10 +329,9 @@ void summarizeTrace(DCFG_DATA_CPTR dcfg, string tracefile)
             cerr << "Reading DCFG trace for PID " << pid << " and TID " << tid << " from '"
                  << tracefile << "'..." << endl;
             string errMsg;
-            if (!traceReader->open(tracefile, tid, errMsg))
+            if (!traceReader.open(tracefile, tid, errMsg))
             {
                 cerr << "error: " << errMsg << endl;
-                delete traceReader;
                 return;
             }
 
@@ -378,18 +343,19 @@ void summarizeTrace(DCFG_DATA_CPTR dcfg, string tracefile)
             // Read until done.
             size_t nRead = 0;
             bool done    = false;
-            DCFG_ID_VECTOR edge_ids;
+            vector<DCFG_TRACE_SPAN> spans;
             while (!done)
             {
-                if (!traceReader->get_edge_ids(edge_ids, done, errMsg))
+                if (!traceReader.get_edge_spans(spans, done, errMsg))
                 {
                     cerr << "error: " << errMsg << endl;
                     done = true;
                 }
-                nRead += edge_ids.size();
-                for (size_t j = 0; j < edge_ids.size(); j++)
+                for (size_t j = 0; j < spans.size(); j++)
                 {
-                    DCFG_ID edgeId = edge_ids[j];
+                    DCFG_ID edgeId = spans[j].edge_id;
+                    UINT64 count   = spans[j].count;
+                    nRead += count;
 
                     // Get edge.
                     DCFG_EDGE_CPTR edge = pinfo->get_edge_info(edgeId);
@@ -397,7 +363,8 @@ void summarizeTrace(DCFG_DATA_CPTR dcfg, string tracefile)
                         continue;
                     if (edge->is_exit_edge_type())
                     {
-                        cout << edgeId << ",end" << endl;
+                        for (UINT64 k = 0; k < count; k++)
+                            cout << edgeId << ",end" << endl;
                         continue;
                     }
 
@@ -408,25 +375,26 @@ void summarizeTrace(DCFG_DATA_CPTR dcfg, string tracefile)
                         continue;
                     const string* symbol = bb->get_symbol_name();
 
-                    // print info.
-                    cout << edgeId << ',' << bbId << ',' << (void*)bb->get_first_instr_addr()
-                         << ',' << '"' << (symbol ? *symbol : "unknown") << '"' << ','
-                         << bb->get_num_instrs() << endl;
+                    // print info, once per execution of the edge.
+                    for (UINT64 k = 0; k < count; k++)
+                        cout << edgeId << ',' << bbId << ',' << (void*)bb->get_first_instr_addr()
+                             << ',' << '"' << (symbol ? *symbol : "unknown") << '"' << ','
+                             << bb->get_num_instrs() << endl;
                 }
-                edge_ids.clear();
+                spans.clear();
             }
             cerr << "Done reading " << nRead << " edges." << endl;
         }
-        delete traceReader;
     }
 }
 
 // Print usage and exit.
 void usage(const char* cmd)
 {
-    cerr << "This program inputs a DCFG file in JSON format and outputs summary data and "
-            "statistics."
+    cerr << "This program inputs a DCFG file in JSON or binary format and outputs summary "
+            "data and statistics."
          << endl
+         << "It optionally converts the DCFG to the memory-mappable binary format." << endl
          << "It optionally inputs a DCFG-Trace file and outputs a sequence of edges." << endl
          << "It optionally prints out stats, to a specified file, \n \t about inner loops "
             "with source file / line number information."
@@ -434,7 +402,8 @@ void usage(const char* cmd)
          << "Usage:" << endl
          << cmd
          << " [ -inner_source_loops_stats <stats-file> -all_source_loops_stats <stts-file> ] "
-            "<dcfg-file> [<dcfg-trace-file>]"
+            "[ -write_binary <binary-dcfg-file> ] <dcfg-file> "
+            "[<dcfg-trace-file>]"
          << endl;
     exit(1);
 }
@@ -477,6 +446,19 @@ void parse_args(int argc, char* argv[])
                     2; // we have consumed two args '-source_loops_stats' and '<source-loops-filename>'
             }
         }
+        else if (string("-write_binary") == string(argv[i]))
+        {
+            if ((i + 1) == argc)
+            {
+                cerr << "Must provide a filename after '-write_binary'." << endl;
+                usage(argv[0]);
+            }
+            else
+            {
+                binary_file = argv[i + 1];
+                i           = i + 2;
+            }
+        }
         else
         {
             if (!dcfg_file)
@@ -511,7 +493,10 @@ int main(int argc, char* argv[])
         usage(argv[0]);
     }
     // Make a new DCFG object.
-    DCFG_DATA* dcfg = DCFG_DATA::new_dcfg();
+    // Binary files are mapped directly instead of being parsed.
+    DCFG_DATA* dcfg = DCFG_BIN_DATA::is_binary_file(dcfg_file) ?
+        static_cast<DCFG_DATA*>(DCFG_BIN_DATA::new_dcfg()) :
+        DCFG_DATA::new_dcfg();
 
     // Read from file.
     cerr << "Reading DCFG from '" << dcfg_file << "'..." << endl;
@@ -523,6 +508,19 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    // Convert to binary format.
+    if (binary_file)
+    {
+        cerr << "Writing binary DCFG to '" << binary_file << "'..." << endl;
+        DCFG_BIN_WRITER writer;
+        if (!writer.write(dcfg, string(binary_file), errMsg))
+        {
+            cerr << "error: " << errMsg << endl;
+            delete dcfg;
+            return 1;
+        }
+    }
+
     // write some summary data from DCFG.
     summarizeDcfg(dcfg);
 
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2025 Intel Corporation.
+// SPDX-License-Identifier: MIT
+//
+
+// Convert a binary frequency-vector file (.bb.fvb, .ldv.fvb) written with
+// -fv-profiler:binary back to the text format read by SimPoint.
+
+#include "fv_binary.H"
+
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Open a file for reading, decompressing through gzip or zstd as needed.
+FILE* openInput(const string& filename, bool& isPipe)
+{
+    static const char* const tools[][2] = {{".gz", "gzip"}, {".zst", "zstd"}};
+    for (size_t i = 0; i < sizeof(tools) / sizeof(tools[0]); i++)
+    {
+        string sfx(tools[i][0]);
+        if (filename.size() > sfx.size() &&
+            filename.compare(filename.size() - sfx.size(), sfx.size(), sfx) == 0)
+        {
+            string cmd = string(tools[i][1]) + " -dc '";
+            for (size_t j = 0; j < filename.size(); j++)
+                cmd += filename[j] == '\'' ? string("'\\''") : string(1, filename[j]);
+            isPipe = true;
+            return popen((cmd + "'").c_str(), "r");
+        }
+    }
+    isPipe = false;
+    return fopen(filename.c_str(), "rb");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        cerr << "Usage: " << argv[0] << " <fvb-file> [<text-file>]" << endl
+             << "Converts a binary frequency-vector file, optionally compressed (.gz, .zst),"
+             << endl
+             << "to the text format. Writes to stdout if no text file is given." << endl;
+        return 1;
+    }
+
+    bool isPipe;
+    FILE* in = openInput(argv[1], isPipe);
+    if (!in)
+    {
+        cerr << "Error: cannot open '" << argv[1] << "'" << endl;
+        return 1;
+    }
+    FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!out)
+    {
+        cerr << "Error: cannot open '" << argv[2] << "'" << endl;
+        return 1;
+    }
+
+    FV_BINARY_HEADER hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+        memcmp(hdr.magic, FV_BINARY_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != FV_BINARY_VERSION)
+    {
+        cerr << "Error: '" << argv[1] << "' is not a binary frequency-vector file" << endl;
+        return 1;
+    }
+
+    // Decode whole records from a window; keep any partial record for the next read.
+    vector<uint8_t> buf;
+    size_t pos = 0;
+    FV_ENTRIES entries;
+    string text;
+    uint64_t sliceEnd, numSlices = 0;
+    bool eof = false;
+    while (!eof || pos < buf.size())
+    {
+        if (!eof)
+        {
+            buf.erase(buf.begin(), buf.begin() + pos);
+            pos         = 0;
+            size_t size = buf.size();
+            buf.resize(size + (1 << 20));
+            size_t n = fread(buf.data() + size, 1, 1 << 20, in);
+            buf.resize(size + n);
+            eof = n == 0;
+        }
+        const uint8_t* p   = buf.data() + pos;
+        const uint8_t* end = buf.data() + buf.size();
+        while (p < end)
+        {
+            const uint8_t* start = p;
+            if (!FvDecodeSlice(p, end, sliceEnd, entries))
+            {
+                p = start;
+                break;
+            }
+            text.clear();
+            FvFormatSlice(text, entries);
+            if (hdr.kind == FV_BINARY_BBV)
+                text += "# Slice ending at " + to_string(sliceEnd) + "\n";
+            fwrite(text.data(), 1, text.size(), out);
+            numSlices++;
+        }
+        pos = p - buf.data();
+        if (eof && pos < buf.size())
+        {
+            cerr << "Error: truncated record at end of '" << argv[1] << "'" << endl;
+            return 1;
+        }
+    }
+
+    if (isPipe)
+        pclose(in);
+    else
+        fclose(in);
+    if (out != stdout)
+        fclose(out);
+    cerr << "Converted " << numSlices << " slices." << endl;
+    return 0;
+}
@@ -0,0 +1,46 @@
+//
+// Copyright (C) 2025 Intel Corporation.
+// SPDX-License-Identifier: MIT
+//
+
+#include <iostream>
+#include <string>
+
+#include "pin.H"
+#include "sde-init.H"
+#include "iregions_control.H"
+
+// sde-control.H will allow to use the SDE's API
+// for requesting a pointer to the SDE's controller
+#include "sde-control.H"
+
+#if defined(PINPLAY)
+#include "sde-pinplay-supp.H"
+using namespace INSTLIB;
+#endif
+
+// Controller from SDE
+using namespace CONTROLLER;
+static CONTROLLER::CONTROL_MANAGER* sde_control = SDE_CONTROLLER::sde_controller_get();
+
+// Create native icount regions object; its knobs are -iregions:*
+KNOB_COMMENT iregion_knob_family("pintool:iregions_control", "Native icount regions knobs");
+CONTROL_ARGS args("i", "pintool:iregions_control");
+CONTROL_IREGIONS_NATIVE iregions(args, sde_control);
+
+// argc, argv are the entire command line, including pin -t <toolname> -- ...
+int main(int argc, char* argv[])
+{
+    sde_pin_init(argc, argv);
+
+    PIN_InitSymbols();
+
+    iregions.Activate();
+
+    sde_init();
+
+    // Start the program, never returns
+    PIN_StartProgram();
+
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include "dcfg_pin_api.H"
 #include "pinplay.H"
 #include "looppoint.H"
+#include "fv-profiler.H"
 #if defined(SDE_INIT)
 #include "sde-init.H"
 #endif
@@ -26,6 +27,7 @@ using namespace dcfg_pin_api;
 
 static ISIMPOINT* isimpoint;
 looppoint::LOOPPOINT loopPoint;
+fv_profiler::FV_PROFILER fvProfiler;
 
 int main(int argc, char* argv[])
 {
@@ -60,6 +62,9 @@ int main(int argc, char* argv[])
     // Activate loop profiling.
     loopPoint.activate(isimpoint);
 
+    // Activate the tool's own frequency-vector profiles if enabled.
+    fvProfiler.activate();
+
     PIN_StartProgram(); // Never returns
     delete dcfgMgr;
     return 0;
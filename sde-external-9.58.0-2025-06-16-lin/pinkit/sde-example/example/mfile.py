@@ -100,14 +100,14 @@ dag = mbuild.dag_t(env=env)
 tools = ['example','agen-example','example-replay',
          'controller-example','reg-example', 'example-procinfo',
          'example-zlib', 'amx-example','pcregions_control',
-         'apx-example' ]
+         'iregions_control', 'apx-example' ]
 if env.on_linux():
     tools.extend(['looppoint','loop-tracker','loop-profiler'])     
 
 # Standalone programs
 programs = {}
 if env.on_linux():
-    programs = ['dcfg-reader']
+    programs = ['dcfg-reader', 'fv-convert']
 
 # Always support pinplay
 mbuild.msgb('PINPLAY IS BEING USED')
@@ -137,6 +137,7 @@ tool_sources['amx-example'] =  ['amx-example.cpp']
 tool_sources['apx-example'] =  ['apx-example.cpp']
 tool_sources['example-zlib'] =  ['example-zlib.cpp']
 tool_sources['pcregions_control'] =  ['pcregions_control.cpp']
+tool_sources['iregions_control'] =  ['iregions_control.cpp']
 if env.on_linux():
     tool_sources['looppoint'] =  ['looppoint.cpp']
     tool_sources['loop-tracker'] =  ['loop-tracker.cpp']
@@ -146,6 +147,7 @@ if env.on_linux():
 programs_sources = {}
 if env.on_linux():
     programs_sources['dcfg-reader'] =  ['dcfg-reader.cpp']
+    programs_sources['fv-convert'] =  ['fv-convert.cpp']
 
 # Build tools
 for tool in tools:
@@ -0,0 +1,325 @@
+#!/usr/bin/env python3
+# -*- python -*-
+
+# Copyright (C) 2025 Intel Corporation.
+# SPDX-License-Identifier: MIT
+#
+
+"""Replay many region pinballs in parallel and merge the tool outputs.
+
+Each pinball is replayed by its own sde64 process, in a work directory of
+its own, with at most --jobs processes running at once. The largest
+pinballs are started first, so the long replays do not end up last. Pinballs
+of the same program that run at the same time share the page cache of their
+memory image files.
+
+The replayer restores the whole memory image of a pinball before the region
+starts, so the start of a replay of a large-footprint program is bound by
+reading its image files. When a replay starts, the files of the pinball
+queued --prefetch places after it are read ahead in the background, so that
+pinball finds them in the page cache when its turn comes.
+
+When all replays are done, the outputs named with --output are merged into
+one file each, weighting every region by its weight:
+  bbv  basic-block vectors (T:id:count lines); the merged file has one
+       vector, the weighted sum of the slices of all regions.
+  csv  tables such as the loop statistics of loop-profiler; rows with the
+       same key columns are merged by the weighted sum of the other columns.
+  kv   "name count" lines such as the global counts of a mix report.
+
+Region weights are read from --weights ("basename weight" lines), or else
+from PinPoints/LoopPoint pinball names, which end with _<cluster>_<a>-<b>
+for the weight a.b. Other pinballs weigh 1.
+
+Example:
+  replay-regions.py -j 16 --tool-args "-t loop-profiler.so \\
+      -loop-profiler:loop-stat-file loops.csv" --output loops.csv:csv \\
+      whole_program.pp/
+"""
+
+import argparse
+import concurrent.futures
+import csv
+import glob
+import os
+import re
+import shlex
+import subprocess
+import sys
+
+PINBALL_SUFFIX = '.address'
+WEIGHT_IN_NAME = re.compile(r'_\d+_(\d+)-(\d+)(?:\.\d+)?$')
+CSV_KEY_WORDS = ('id', 'name', 'file', 'addr', 'line')
+
+
+def kit_root():
+    """The SDE kit directory, three levels above this script."""
+    here = os.path.dirname(os.path.abspath(__file__))
+    return os.path.dirname(os.path.dirname(os.path.dirname(here)))
+
+
+def find_pinballs(paths):
+    """Return the pinball basenames in paths (basenames or directories)."""
+    basenames = []
+    for path in paths:
+        if os.path.isdir(path):
+            files = glob.glob(os.path.join(path, '**', '*' + PINBALL_SUFFIX), recursive=True)
+            basenames.extend(f[:-len(PINBALL_SUFFIX)] for f in files)
+        elif path.endswith(PINBALL_SUFFIX):
+            basenames.append(path[:-len(PINBALL_SUFFIX)])
+        else:
+            basenames.append(path)
+    return sorted(set(basenames))
+
+
+def pinball_size(basename):
+    return sum(os.path.getsize(f) for f in glob.glob(basename + '.*') if os.path.isfile(f))
+
+
+def prefetch(basename):
+    """Ask the kernel to read the files of a pinball ahead, without waiting."""
+    if not hasattr(os, 'posix_fadvise'):
+        return
+    for f in glob.glob(basename + '.*'):
+        try:
+            fd = os.open(f, os.O_RDONLY)
+        except OSError:
+            continue
+        try:
+            os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_WILLNEED)
+        except OSError:
+            pass
+        finally:
+            os.close(fd)
+
+
+def read_weights(filename):
+    weights = {}
+    with open(filename) as f:
+        for line in f:
+            fields = line.replace(',', ' ').split()
+            if len(fields) >= 2 and not line.startswith('#'):
+                weights[os.path.basename(fields[0])] = float(fields[1])
+    return weights
+
+
+def region_weight(basename, weights):
+    name = os.path.basename(basename)
+    if name in weights:
+        return weights[name]
+    m = WEIGHT_IN_NAME.search(name)
+    if m:
+        return float(m.group(1) + '.' + m.group(2))
+    return 1.0
+
+
+def substitute(text, basename, workdir):
+    return (text.replace('{basename}', basename)
+                .replace('{region}', os.path.basename(basename))
+                .replace('{workdir}', workdir))
+
+
+def replay(args, basename, workdir, next_basename=None):
+    """Replay one pinball in workdir. Return (basename, exit code)."""
+    os.makedirs(workdir, exist_ok=True)
+    if next_basename and not args.dry_run:
+        prefetch(next_basename)
+    cmd = [args.sde] + shlex.split(args.sde_args)
+    cmd += ['-replay', '-replay:basename', os.path.abspath(basename)]
+    cmd += [substitute(a, basename, workdir) for a in shlex.split(args.tool_args)]
+    cmd += ['--', args.nullapp]
+    if args.dry_run:
+        print('cd %s && %s' % (shlex.quote(workdir), ' '.join(shlex.quote(c) for c in cmd)))
+        return basename, 0
+    with open(os.path.join(workdir, 'replay.log'), 'w') as log:
+        try:
+            code = subprocess.call(cmd, cwd=workdir, stdout=log, stderr=subprocess.STDOUT)
+        except OSError as e:
+            log.write('%s: %s\n' % (cmd[0], e))
+            code = 127
+    return basename, code
+
+
+def merge_bbv(inputs, out):
+    total = {}
+    for filename, weight in inputs:
+        with open(filename) as f:
+            for line in f:
+                if not line.startswith('T'):
+                    continue
+                for field in line[1:].split():
+                    _, bb, count = field.split(':')
+                    total[int(bb)] = total.get(int(bb), 0.0) + weight * int(count)
+    out.write('T')
+    for bb in sorted(total):
+        out.write(':%d:%d ' % (bb, round(total[bb])))
+    out.write('\n')
+
+
+def is_number(text):
+    try:
+        float(text)
+        return True
+    except ValueError:
+        return False
+
+
+def csv_keys(header, row, num_keys):
+    """The key columns of a table: the first num_keys ones, or else the ones
+    named like keys and the non-numeric ones of its first row."""
+    if num_keys is not None:
+        return list(range(num_keys))
+    return [i for i, name in enumerate(header)
+            if any(w in name.lower() for w in CSV_KEY_WORDS) or
+            i >= len(row) or not is_number(row[i])]
+
+
+def merge_csv(inputs, out, num_keys):
+    header = None
+    keys = None
+    rows = {}
+    order = []
+    for filename, weight in inputs:
+        with open(filename, newline='') as f:
+            reader = csv.reader(f)
+            file_header = next(reader, None)
+            if file_header is None:
+                continue
+            if header is None:
+                header = file_header
+            for row in reader:
+                if keys is None:
+                    key_columns = csv_keys(header, row, num_keys)
+                    keys = frozenset(key_columns)
+                key = tuple(row[i] for i in key_columns if i < len(row))
+                if key not in rows:
+                    rows[key] = ([0.0] * len(row), list(row))
+                    order.append(key)
+                sums, _ = rows[key]
+                for i, value in enumerate(row[:len(sums)]):
+                    if i not in keys and is_number(value):
+                        sums[i] += weight * float(value)
+    writer = csv.writer(out, lineterminator='\n')
+    if header is not None:
+        writer.writerow(header)
+    for key in order:
+        sums, first = rows[key]
+        writer.writerow([first[i] if i in keys or not is_number(first[i]) else '%.2f' % sums[i]
+                         for i in range(len(first))])
+
+
+def merge_kv(inputs, out):
+    total = {}
+    order = []
+    for filename, weight in inputs:
+        with open(filename) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) != 2 or not is_number(fields[1]) or line.startswith('#'):
+                    continue
+                if fields[0] not in total:
+                    total[fields[0]] = 0.0
+                    order.append(fields[0])
+                total[fields[0]] += weight * float(fields[1])
+    for name in order:
+        out.write('%-40s %.0f\n' % (name, total[name]))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('pinballs', nargs='+',
+                        help='pinball basenames, or directories to search for pinballs')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count() or 1,
+                        help='replays to run at once (default: number of cores)')
+    parser.add_argument('--sde', default=os.path.join(kit_root(), 'sde64'),
+                        help='sde64 launcher')
+    parser.add_argument('--nullapp', default=os.path.join(kit_root(), 'intel64', 'nullapp'),
+                        help='application passed to the replayer')
+    parser.add_argument('--sde-args', default='', help='extra sde64 options')
+    parser.add_argument('--tool-args', default='',
+                        help='tool options; {basename}, {region} and {workdir} are replaced')
+    parser.add_argument('--work-dir', default='replay-regions',
+                        help='directory holding a work directory per region, '
+                             'named <index>-<pinball name>')
+    parser.add_argument('--output', action='append', default=[], metavar='FILE:KIND',
+                        help='tool output to merge, relative to the region work directory; '
+                             'KIND is bbv, csv or kv')
+    parser.add_argument('--csv-keys', type=int, default=None,
+                        help='number of leading key columns of csv outputs '
+                             '(default: id/name/file/addr/line and non-numeric columns)')
+    parser.add_argument('--prefetch', type=int, default=None,
+                        help='read ahead the files of the pinball this many places later '
+                             'in the queue when a replay starts; 0 disables '
+                             '(default: --jobs)')
+    parser.add_argument('--weights', help='file of "basename weight" lines')
+    parser.add_argument('--merged-dir', default='.', help='directory of the merged outputs')
+    parser.add_argument('--dry-run', action='store_true', help='print the replay commands')
+    args = parser.parse_args()
+
+    # replays run in their work directories
+    for name in ('sde', 'nullapp'):
+        path = getattr(args, name)
+        if os.sep in path:
+            setattr(args, name, os.path.abspath(path))
+
+    outputs = []
+    for spec in args.output:
+        filename, _, kind = spec.rpartition(':')
+        if kind not in ('bbv', 'csv', 'kv') or not filename:
+            parser.error('bad --output %s' % spec)
+        outputs.append((filename, kind))
+
+    basenames = find_pinballs(args.pinballs)
+    if not basenames:
+        parser.error('no pinballs found')
+    weights = read_weights(args.weights) if args.weights else {}
+    # pinballs of different directories may have the same name
+    workdirs = dict((b, os.path.abspath(os.path.join(args.work_dir,
+                                                     '%d-%s' % (i, os.path.basename(b)))))
+                    for i, b in enumerate(basenames))
+
+    # largest first, for load balance
+    schedule = sorted(basenames, key=pinball_size, reverse=True)
+    jobs = max(1, args.jobs)
+    ahead = jobs if args.prefetch is None else args.prefetch
+    failed = []
+    with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as pool:
+        futures = []
+        for i, b in enumerate(schedule):
+            later = schedule[i + ahead] if ahead > 0 and i + ahead < len(schedule) else None
+            futures.append(pool.submit(replay, args, b, workdirs[b], later))
+        for done, future in enumerate(concurrent.futures.as_completed(futures), 1):
+            basename, code = future.result()
+            status = 'ok' if code == 0 else 'FAILED (%d)' % code
+            sys.stderr.write('[%d/%d] %s %s\n' % (done, len(futures),
+                                                  os.path.basename(basename), status))
+            if code != 0:
+                failed.append(basename)
+    if args.dry_run:
+        return 0
+
+    for filename, kind in outputs:
+        inputs = []
+        for b in basenames:
+            path = os.path.join(workdirs[b], substitute(filename, b, workdirs[b]))
+            if b not in failed and os.path.exists(path):
+                inputs.append((path, region_weight(b, weights)))
+            elif b not in failed:
+                sys.stderr.write('warning: missing %s\n' % path)
+        merged = os.path.join(args.merged_dir,
+                              'merged.' + os.path.basename(substitute(filename, '', '')))
+        with open(merged, 'w') as out:
+            if kind == 'bbv':
+                merge_bbv(inputs, out)
+            elif kind == 'csv':
+                merge_csv(inputs, out, args.csv_keys)
+            else:
+                merge_kv(inputs, out)
+        sys.stderr.write('merged %d regions into %s\n' % (len(inputs), merged))
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -7,6 +7,7 @@
 #include <sstream>
 #include <iomanip>
 #include <string.h>
+#include <algorithm>
 #include "call-stack.H"
 using std::dec;
 using std::endl;
@@ -28,18 +29,22 @@ using std::vector;
 
 using namespace CALLSTACK;
 static REG vreg;
+static const char UNKNOWN_IMAGE[] = "UNKNOWN IMAGE";
 KNOB_COMMENT _comment("pintool:call-stack", "Call Stack knobs");
 KNOB< BOOL > _knob_source_location(KNOB_MODE_WRITEONCE, "pintool:call-stack", "callstack:source_locaion", "1",
                                    "Emit source location (file,line,column) ");
+KNOB< UINT32 > _knob_max_depth(KNOB_MODE_WRITEONCE, "pintool:call-stack", "callstack:max_depth", "4096",
+                               "Entries kept per thread call stack, rounded up to a power of two. "
+                               "Deeper calls overwrite the bottom-most entries");
 
 ///////////////////////// Analysis Functions //////////////////////////////////
-static void a_process_call(ADDRINT target, ADDRINT sp, CallStack* call_stack)
+static void a_process_call(ADDRINT target, ADDRINT sp, ThreadCallStack* call_stack)
 {
     ASSERTX(call_stack);
     call_stack->process_call(sp, target);
 }
 
-static void a_process_return(ADDRINT sp, ADDRINT ip, CallStack* call_stack)
+static void a_process_return(ADDRINT sp, ADDRINT ip, ThreadCallStack* call_stack)
 {
     ASSERTX(call_stack);
     call_stack->process_return(sp, ip);
@@ -314,12 +319,98 @@ void CallStack::get_targets(list< ADDRINT >& out)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+ThreadCallStack::ThreadCallStack(UINT32 max_depth) : _depth(0), _lost(0), _seq(0)
+{
+    UINT32 size = 1;
+    while (size < max_depth && size < (1U << 31))
+    {
+        size <<= 1;
+    }
+    _ring = new RingEntry[size];
+    _mask = size - 1;
+}
+
+ThreadCallStack::~ThreadCallStack() { delete[] _ring; }
+
+// roll back stack if we got here from a longjmp.
+// lost entries cannot be checked, so we stop at the oldest entry we have.
+void ThreadCallStack::adjust_stack(ADDRINT current_sp)
+{
+    UINT32 depth = _depth;
+    while (depth > _lost && current_sp >= _ring[(depth - 1) & _mask].sp)
+    {
+        depth--;
+    }
+    _depth = depth;
+}
+
+void ThreadCallStack::process_call(ADDRINT current_sp, ADDRINT target)
+{
+    begin_update();
+    adjust_stack(current_sp);
+    RingEntry& entry = _ring[_depth & _mask];
+    entry.sp         = current_sp;
+    entry.target     = target;
+    _depth           = _depth + 1;
+    if (_depth - _lost > _mask + 1)
+    {
+        _lost = _lost + 1;
+    }
+    end_update();
+}
+
+void ThreadCallStack::process_return(ADDRINT current_sp, ADDRINT ip)
+{
+    begin_update();
+    adjust_stack(current_sp);
+    //see CallStack::process_return for returns on an empty stack
+    if (_depth > 0)
+    {
+        _depth = _depth - 1;
+        if (_lost > _depth)
+        {
+            _lost = _depth;
+        }
+    }
+    end_update();
+}
+
+// copy the live entries, retrying while the owner thread updates the stack.
+// the ring and the sequence number are volatile so the compiler keeps the
+// copy between the two reads of the sequence number.
+void ThreadCallStack::snapshot(CallStack& out) const
+{
+    CallStack::CallVec& vec = out._call_vec;
+    for (;;)
+    {
+        UINT32 seq = ATOMIC::OPS::Load(&_seq, ATOMIC::BARRIER_LD_NEXT);
+        if (seq & 1)
+        {
+            continue;
+        }
+        UINT32 depth = _depth;
+        UINT32 lost  = _lost;
+        vec.clear();
+        for (UINT32 i = lost; i < depth; i++)
+        {
+            const RingEntry& entry = _ring[i & _mask];
+            vec.push_back(CallEntry(entry.sp, entry.target));
+        }
+        if (ATOMIC::OPS::Load(&_seq) == seq)
+        {
+            return;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 CallStackManager* CallStackManager::_instance = 0;
 
 // Handle new thread
 void CallStackManager::thread_begin(THREADID tid, CONTEXT* ctxt, INT32 flags, void* v)
 {
-    CallStack* call_stack = new CallStack();
+    ThreadCallStack* call_stack = new ThreadCallStack(_knob_max_depth);
     ASSERTX(call_stack);
     ASSERTX(v);
     ASSERTX(ctxt);
@@ -331,12 +422,11 @@ void CallStackManager::thread_begin(THREADID tid, CONTEXT* ctxt, INT32 flags, vo
 }
 
 // Add the call stack of a new thread
-void CallStackManager::add_stack(THREADID tid, CallStack* call_stack)
+void CallStackManager::add_stack(THREADID tid, ThreadCallStack* call_stack)
 {
     ASSERTX(call_stack);
-    PIN_GetLock(&_map_lock, tid + 1);
-    _call_stack_map[tid] = call_stack;
-    PIN_ReleaseLock(&_map_lock);
+    ASSERTX(tid < PIN_MAX_THREADS);
+    ATOMIC::OPS::Store(&_stacks[tid], call_stack, ATOMIC::BARRIER_ST_PREV);
 }
 
 // Activate call stack manager if needed
@@ -353,6 +443,7 @@ void CallStackManager::activate()
     PIN_AddThreadStartFunction(thread_begin, this);
     TRACE_AddInstrumentFunction(i_trace, this);
     IMG_AddInstrumentFunction(Img, this);
+    IMG_AddUnloadFunction(ImgUnload, this);
 }
 
 // Get call stack manager instance and create it if needed
@@ -369,40 +460,130 @@ CallStackManager* CallStackManager::get_instance()
     return _instance;
 }
 
-// Get call stack of a specific IP
+// Get a snapshot of the call stack of a specific thread
 CallStack CallStackManager::get_stack(THREADID tid)
 {
-    PIN_GetLock(&_map_lock, tid + 1);
-    CallStack* call_stack = _call_stack_map[tid];
-    PIN_ReleaseLock(&_map_lock);
+    ASSERTX(tid < PIN_MAX_THREADS);
+    ThreadCallStack* call_stack = ATOMIC::OPS::Load(&_stacks[tid], ATOMIC::BARRIER_LD_NEXT);
     ASSERTX(call_stack);
-    return *call_stack; //copy const.
+    CallStack copy;
+    call_stack->snapshot(copy);
+    return copy;
 }
 
 // Get call stack and source information for a specific IP
 void CallStackManager::get_ip_info(ADDRINT ip, CallStackInfo& info)
 {
-    PIN_GetLock(&_lock, 0);
+    // Fibonacci hashing of the ip
+    UINT32 bucket                       = UINT32((UINT64(ip) * 0x9E3779B97F4A7C15ULL) >> 50) & (INFO_BUCKETS - 1);
+    CallStackInfoNode* volatile* head_p = &_info_buckets[bucket];
+    UINT32 epoch                        = ATOMIC::OPS::Load(&_info_epoch, ATOMIC::BARRIER_LD_NEXT);
+    CallStackInfoNode* head             = ATOMIC::OPS::Load(head_p, ATOMIC::BARRIER_LD_NEXT);
+
+    // If we already have information for this IP then just return it.
+    // new nodes are added at the head, so the first node of ip is the newest
+    for (CallStackInfoNode* node = head; node; node = node->next)
+    {
+        if (node->ip == ip)
+        {
+            if (node->epoch != epoch) break;
+            info = node->info;
+            return;
+        }
+    }
 
-    // If we already have information for this IP then just return it
-    CallStackInfoMap::iterator it = _call_stack_info.find(ip);
+    // We got here for new IP
+    CallStackInfoNode* new_node = new CallStackInfoNode();
+    new_node->ip                = ip;
+    new_node->epoch             = epoch;
+    create_ip_info(ip, new_node->info);
+
+    // Add new information to our database.
+    // if another thread added the same ip meanwhile, use its node instead.
+    for (;;)
+    {
+        new_node->next = head;
+        if (ATOMIC::OPS::CompareAndDidSwap(head_p, head, new_node, ATOMIC::BARRIER_CS_PREV))
+        {
+            info = new_node->info;
+            return;
+        }
+        CallStackInfoNode* old_head = head;
+        head                        = ATOMIC::OPS::Load(head_p, ATOMIC::BARRIER_LD_NEXT);
+        for (CallStackInfoNode* node = head; node != old_head; node = node->next)
+        {
+            if (node->ip == ip && node->epoch == epoch)
+            {
+                info = node->info;
+                free_ip_info(new_node->info);
+                delete new_node;
+                return;
+            }
+        }
+    }
+}
 
-    if (it != _call_stack_info.end())
+const RtnRange* ImageSymbolIndex::find(ADDRINT ip) const
+{
+    RtnRange key;
+    key.low                               = ip;
+    vector< RtnRange >::const_iterator it = std::upper_bound(rtns.begin(), rtns.end(), key);
+    if (it == rtns.begin())
     {
-        PIN_ReleaseLock(&_lock);
-        info = it->second;
-        return;
+        return 0;
     }
+    --it;
+    return (ip < it->high) ? &*it : 0;
+}
 
-    // We got here for new IP
-    CallStackInfo curr_info;
+// Get routine and image information of ip from the symbol index.
+// return FALSE if ip is not in an indexed image
+BOOL CallStackManager::create_ip_info_from_index(ADDRINT ip, CallStackInfo& curr_info)
+{
+    BOOL found = FALSE;
+    PIN_RWMutexReadLock(&_index_lock);
+    ImageIndexMap::const_iterator it = _image_index.upper_bound(ip);
+    if (it != _image_index.begin())
+    {
+        --it;
+        const ImageSymbolIndex* index = it->second;
+        if (ip <= index->high)
+        {
+            const RtnRange* rtn = index->find(ip);
+            curr_info.rtn_id    = rtn ? rtn->rtn_id : RTN_Id(RTN_Invalid());
+            curr_info.func_name = strdup(rtn ? rtn->name.c_str() : "");
+            // The string contains image name and the offset of
+            // the instruction
+            string curr_image_name = index->name + ":" + hexstr(ip - index->low);
+            curr_info.image_name   = strdup(curr_image_name.c_str());
+            found                  = TRUE;
+        }
+    }
+    PIN_RWMutexUnlock(&_index_lock);
+    return found;
+}
+
+// Get routine, image and source information of a new IP
+void CallStackManager::create_ip_info(ADDRINT ip, CallStackInfo& curr_info)
+{
     string curr_file_name;
 
+    // the symbol index has the routine and image, but not the source location
+    BOOL indexed = create_ip_info_from_index(ip, curr_info);
+    if (indexed && !_knob_source_location)
+    {
+        return;
+    }
+
     // Get routine and image information
     PIN_LockClient();
-    curr_info.rtn_id    = RTN_Id(RTN_FindByAddress(ip));
-    curr_info.func_name = strdup(RTN_FindNameByAddress(ip).c_str());
-    IMG img             = IMG_FindByAddress(ip);
+    IMG img = IMG_Invalid();
+    if (!indexed)
+    {
+        curr_info.rtn_id    = RTN_Id(RTN_FindByAddress(ip));
+        curr_info.func_name = strdup(RTN_FindNameByAddress(ip).c_str());
+        img                 = IMG_FindByAddress(ip);
+    }
 
     // Get source location if neeed
     if (_knob_source_location)
@@ -413,6 +594,11 @@ void CallStackManager::get_ip_info(ADDRINT ip, CallStackInfo& info)
 
     PIN_UnlockClient();
 
+    if (indexed)
+    {
+        return;
+    }
+
     // Analyze image information
     string curr_image_name;
     if (IMG_Valid(img))
@@ -426,14 +612,19 @@ void CallStackManager::get_ip_info(ADDRINT ip, CallStackInfo& info)
     }
     else
     {
-        curr_info.image_name = (char*)("UNKNOWN IMAGE");
+        curr_info.image_name = (char*)(UNKNOWN_IMAGE);
     }
+}
 
-    // Add new information to our database
-    info                 = curr_info;
-    _call_stack_info[ip] = curr_info;
-
-    PIN_ReleaseLock(&_lock);
+// Free the strings of info generated by create_ip_info
+void CallStackManager::free_ip_info(CallStackInfo& info)
+{
+    free(info.func_name);
+    free(info.file_name);
+    if (info.image_name != UNKNOWN_IMAGE)
+    {
+        free(info.image_name);
+    }
 }
 
 BOOL CallStackManager::NeedContext() { return _use_ctxt; }
@@ -486,9 +677,11 @@ void CallStackManager::on_function_ip_exit(CALL_STACK_HANDLER handler, ADDRINT f
 // 2. whether the function was registered in on_function_exit.
 //    if so store the ip of the interesting function with the relevant
 //    vector of handlers.
+// and add the image to the symbol index.
 void CallStackManager::Img(IMG img, void* v)
 {
     CallStackManager* mngr = static_cast< CallStackManager* >(v);
+    mngr->index_image(img);
 
     for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
     {
@@ -522,6 +715,52 @@ void CallStackManager::Img(IMG img, void* v)
     }
 }
 
+// build the symbol index of a loaded image
+void CallStackManager::index_image(IMG img)
+{
+    ImageSymbolIndex* index = new ImageSymbolIndex();
+    index->low              = IMG_LowAddress(img);
+    index->high             = IMG_HighAddress(img);
+    index->name             = IMG_Name(img);
+    for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+    {
+        for (RTN rtn = SEC_RtnHead(sec); RTN_Valid(rtn); rtn = RTN_Next(rtn))
+        {
+            RtnRange range;
+            range.low    = RTN_Address(rtn);
+            range.high   = range.low + RTN_Size(rtn);
+            range.rtn_id = RTN_Id(rtn);
+            range.name   = RTN_Name(rtn);
+            index->rtns.push_back(range);
+        }
+    }
+    std::sort(index->rtns.begin(), index->rtns.end());
+
+    PIN_RWMutexWriteLock(&_index_lock);
+    ImageSymbolIndex*& entry = _image_index[index->low];
+    delete entry;
+    entry = index;
+    PIN_RWMutexUnlock(&_index_lock);
+}
+
+// drop the symbol index of an unloaded image.
+// the cached info may refer to the image, so all of it becomes stale;
+// unloads are rare enough that it is not worth tracking the image of each ip
+void CallStackManager::ImgUnload(IMG img, void* v)
+{
+    CallStackManager* mngr = static_cast< CallStackManager* >(v);
+
+    PIN_RWMutexWriteLock(&mngr->_index_lock);
+    ImageIndexMap::iterator it = mngr->_image_index.find(IMG_LowAddress(img));
+    if (it != mngr->_image_index.end())
+    {
+        delete it->second;
+        mngr->_image_index.erase(it);
+    }
+    ATOMIC::OPS::Increment(&mngr->_info_epoch, (UINT32)1);
+    PIN_RWMutexUnlock(&mngr->_index_lock);
+}
+
 // called after the execution of call/direct/indirect jump
 //
 // 1. check whether the target ip is present in the map of ip->handlers for enter to fuction
@@ -559,7 +798,7 @@ void CallStackManager::on_call(THREADID tid, CONTEXT* ctxt, ADDRINT ip)
     iter = _exit_func_handlers_map.find(ip);
     if (iter != _exit_func_handlers_map.end())
     {
-        UINT32 depth            = get_stack(tid).depth();
+        UINT32 depth            = stack_depth(tid);
         DepthFuncHandlersMap& m = _depth_func_handlers_tid_vec[tid];
         m[depth]                = iter->second; //a vector of handlers
         _marked_ip_for_exit.insert(ip);
@@ -574,7 +813,7 @@ void CallStackManager::on_call(THREADID tid, CONTEXT* ctxt, ADDRINT ip)
 BOOL CallStackManager::on_ret_should_fire(THREADID tid)
 {
     BOOL was_found = FALSE;
-    UINT32 depth   = get_stack(tid).depth();
+    UINT32 depth   = stack_depth(tid);
     DepthFuncHandlersMap::iterator iter;
     DepthFuncHandlersMap& m = _depth_func_handlers_tid_vec[tid];
 
@@ -600,7 +839,7 @@ BOOL CallStackManager::on_ret_should_fire(THREADID tid)
 //    2. remove the 'depth' entry so it will not be call again later.
 void CallStackManager::on_ret_fire(THREADID tid, CONTEXT* ctxt, ADDRINT ip)
 {
-    UINT32 depth = get_stack(tid).depth();
+    UINT32 depth = stack_depth(tid);
     DepthFuncHandlersMap::iterator iter;
     DepthFuncHandlersMap::iterator earase_iter;
     DepthFuncHandlersMap& m = _depth_func_handlers_tid_vec[tid];
@@ -7,8 +7,13 @@
  *  Pool of threads.
  */
 
+#include <immintrin.h>
 #include "thread_pool.h"
 
+// The WORKER of the current thread if it belongs to a pool, used to queue objects
+// submitted by objects run in the pool on the deque of their own thread.
+static thread_local void* currentWorker = 0;
+
 //=======================================================================
 // Implementation of the THREAD_POOL class
 //=======================================================================
@@ -18,11 +23,13 @@ unsigned long THREAD_POOL::Create(unsigned long numThreads)
     unsigned long count;
     for (count = 0; (count < numThreads) && (m_numThreads < MAXTHREADS); ++count, ++m_numThreads)
     {
-        TLS_ELEMENT* tls = &(m_tls[m_numThreads]);
-        tls->Init();
-        BOOL created = CreateOneThread(&(tls->m_handle), ThreadRoutine, tls);
+        // publish the worker before the threads that steal from it can see it
+        WORKER* worker          = new WORKER(this, m_numThreads);
+        m_workers[m_numThreads] = worker;
+        BOOL created            = CreateOneThread(&(worker->m_handle), ThreadRoutine, worker);
         if (!created)
         {
+            delete worker;
             break;
         }
     }
@@ -31,14 +38,33 @@ unsigned long THREAD_POOL::Create(unsigned long numThreads)
 
 void THREAD_POOL::TerminateAll()
 {
-    EXIT_THREAD_OBJ exitObj;
+    if (m_numThreads == 0)
+    {
+        return;
+    }
+    WaitAll();
     for (unsigned long tid = 0; tid < m_numThreads; ++tid)
     {
         Wait(tid);
-        Start(tid, &exitObj); // run EXIT_THREAD_OBJ in the target thread to exit the thread
-        JoinOneThread(m_tls[tid].m_handle);
+    }
+    {
+        std::lock_guard< std::mutex > lock(m_parkLock);
+        m_stop = true;
+        for (unsigned long tid = 0; tid < m_numThreads; ++tid)
+        {
+            m_workers[tid]->m_wakeCond.notify_one();
+        }
+    }
+    for (unsigned long tid = 0; tid < m_numThreads; ++tid)
+    {
+        JoinOneThread(m_workers[tid]->m_handle);
+    }
+    for (unsigned long tid = 0; tid < m_numThreads; ++tid)
+    {
+        delete m_workers[tid];
     }
     m_numThreads = 0;
+    m_stop       = false;
 }
 
 bool THREAD_POOL::Start(unsigned long tid, RUNNABLE_OBJ* runObj)
@@ -48,15 +74,20 @@ bool THREAD_POOL::Start(unsigned long tid, RUNNABLE_OBJ* runObj)
         return false;
     }
 
-    TLS_ELEMENT* tls = &(m_tls[tid]);
-    if (tls->CheckSemaphore() == true)
+    WORKER* worker = m_workers[tid];
     {
-        return false; // can not start a new task until a previous one is not yet completed
+        std::lock_guard< std::mutex > lock(m_doneLock);
+        if (worker->m_busy)
+        {
+            return false; // can not start a new task until a previous one is not yet completed
+        }
+        worker->m_busy = true;
     }
 
     // switch control to the specified thread in the pool
-    tls->m_runObj = runObj;
-    tls->SwitchSemaphore(true);
+    worker->m_runObj = runObj;
+    worker->m_assigned.store(true);
+    WakeWorker(worker); // only the specified thread can run the object
     return true;
 }
 
@@ -67,44 +98,216 @@ RUNNABLE_OBJ* THREAD_POOL::Wait(unsigned long tid)
         return 0;
     }
 
-    TLS_ELEMENT* tls = &(m_tls[tid]);
-    tls->WaitSemaphore(false);
-    return tls->m_runObj;
+    WORKER* worker = m_workers[tid];
+    std::unique_lock< std::mutex > lock(m_doneLock);
+    while (worker->m_busy)
+    {
+        m_doneCond.wait(lock);
+    }
+    return worker->m_runObj;
 }
 
-void* THREAD_POOL::ThreadRoutine(void* tlsArg)
+bool THREAD_POOL::Submit(RUNNABLE_OBJ* runObj) { return SubmitBatch(&runObj, 1); }
+
+bool THREAD_POOL::SubmitBatch(RUNNABLE_OBJ* const* runObjs, unsigned long numObjs)
 {
-    TLS_ELEMENT* tls = static_cast< TLS_ELEMENT* >(tlsArg);
-    while (true)
+    if (m_numThreads == 0)
     {
-        tls->WaitSemaphore(true);
-        tls->m_runObj->Run();
-        // switch control back to the managing thread
-        tls->SwitchSemaphore(false);
+        return false;
     }
-    return 0;
+    if (numObjs == 0)
+    {
+        return true;
+    }
+    m_pending += numObjs;
+
+    WORKER* self = static_cast< WORKER* >(currentWorker);
+    if (self && self->m_pool == this)
+    {
+        // submitted by an object run in the pool: keep the objects local,
+        // other threads steal them if they are idle
+        std::lock_guard< std::mutex > lock(self->m_lock);
+        self->m_tasks.insert(self->m_tasks.end(), runObjs, runObjs + numObjs);
+    }
+    else
+    {
+        unsigned long numThreads = m_numThreads;
+        unsigned long numBatches = (numObjs < numThreads) ? numObjs : numThreads;
+        unsigned long begin      = 0;
+        for (unsigned long batch = 0; batch < numBatches; ++batch)
+        {
+            unsigned long end = numObjs * (batch + 1) / numBatches;
+            WORKER* worker    = m_workers[m_nextWorker];
+            m_nextWorker      = (m_nextWorker + 1) % numThreads;
+            std::lock_guard< std::mutex > lock(worker->m_lock);
+            worker->m_tasks.insert(worker->m_tasks.end(), runObjs + begin, runObjs + end);
+            begin = end;
+        }
+    }
+    m_queued += numObjs;
+    WakeUp(numObjs > 1);
+    return true;
+}
+
+void THREAD_POOL::WaitAll()
+{
+    std::unique_lock< std::mutex > lock(m_doneLock);
+    while (m_pending.load() != 0)
+    {
+        m_doneCond.wait(lock);
+    }
+}
+
+void THREAD_POOL::WakeUp(bool all)
+{
+    // a thread going to sleep increments m_idle before it checks m_queued,
+    // and we increment m_queued before we check m_idle, so either it sees
+    // the new objects or we see it. a sleeping thread is marked parked under
+    // m_parkLock; the mark is cleared when it is woken, so that the next
+    // call wakes another thread.
+    if (m_idle.load() == 0)
+    {
+        return;
+    }
+    std::lock_guard< std::mutex > lock(m_parkLock);
+    unsigned long numThreads = m_numThreads;
+    for (unsigned long tid = 0; tid < numThreads; ++tid)
+    {
+        WORKER* worker = m_workers[tid];
+        if (worker->m_parked)
+        {
+            worker->m_parked = false;
+            worker->m_wakeCond.notify_one();
+            if (!all)
+            {
+                return;
+            }
+        }
+    }
+}
+
+void THREAD_POOL::WakeWorker(WORKER* worker)
+{
+    // the thread checks m_assigned under m_parkLock before it sleeps
+    std::lock_guard< std::mutex > lock(m_parkLock);
+    worker->m_parked = false;
+    worker->m_wakeCond.notify_one();
 }
 
-void THREAD_POOL::TLS_ELEMENT::SwitchSemaphore(bool semaphoreState)
+RUNNABLE_OBJ* THREAD_POOL::NextTask(WORKER* worker, bool& assigned)
 {
-    DelayCurrentThread(0); // we use this system call as a memory fence
-    m_semaphore = semaphoreState;
+    assigned = worker->m_assigned.load();
+    if (assigned)
+    {
+        worker->m_assigned.store(false);
+        return worker->m_runObj;
+    }
+
+    {
+        std::lock_guard< std::mutex > lock(worker->m_lock);
+        if (!worker->m_tasks.empty())
+        {
+            RUNNABLE_OBJ* runObj = worker->m_tasks.back();
+            worker->m_tasks.pop_back();
+            --m_queued;
+            return runObj;
+        }
+    }
+    return Steal(worker);
 }
 
-void THREAD_POOL::TLS_ELEMENT::WaitSemaphore(bool semaphoreState) const
+RUNNABLE_OBJ* THREAD_POOL::Steal(WORKER* thief)
 {
-    while (m_semaphore != semaphoreState)
+    if (m_queued.load() == 0)
     {
-        DelayCurrentThread(0);
+        return 0;
     }
-    DelayCurrentThread(0); // we use this system call as a memory fence
+    unsigned long numThreads = m_numThreads;
+    for (unsigned long i = 1; i < numThreads; ++i)
+    {
+        WORKER* victim = m_workers[(thief->m_tid + i) % numThreads];
+        std::deque< RUNNABLE_OBJ* > stolen;
+        {
+            std::lock_guard< std::mutex > lock(victim->m_lock);
+            size_t numStolen = (victim->m_tasks.size() + 1) / 2;
+            if (numStolen == 0)
+            {
+                continue;
+            }
+            // take the oldest objects, the victim keeps running its most recent ones
+            stolen.assign(victim->m_tasks.begin(), victim->m_tasks.begin() + numStolen);
+            victim->m_tasks.erase(victim->m_tasks.begin(), victim->m_tasks.begin() + numStolen);
+        }
+        RUNNABLE_OBJ* runObj = stolen.front();
+        stolen.pop_front();
+        --m_queued;
+        if (!stolen.empty())
+        {
+            std::lock_guard< std::mutex > lock(thief->m_lock);
+            thief->m_tasks.insert(thief->m_tasks.end(), stolen.begin(), stolen.end());
+        }
+        return runObj;
+    }
+    return 0;
 }
 
-bool THREAD_POOL::TLS_ELEMENT::CheckSemaphore() const
+bool THREAD_POOL::Park(WORKER* worker)
 {
-    bool semaphoreState = m_semaphore;
-    DelayCurrentThread(0); // we use this system call as a memory fence
-    return semaphoreState;
+    for (unsigned long i = 0; i < SPIN_COUNT; ++i)
+    {
+        if (m_queued.load(std::memory_order_relaxed) != 0 ||
+            worker->m_assigned.load(std::memory_order_relaxed))
+        {
+            return true;
+        }
+        _mm_pause();
+    }
+
+    ++m_idle;
+    std::unique_lock< std::mutex > lock(m_parkLock);
+    while (!m_stop && m_queued.load() == 0 && !worker->m_assigned.load())
+    {
+        worker->m_parked = true;
+        worker->m_wakeCond.wait(lock);
+    }
+    worker->m_parked = false;
+    --m_idle;
+    return !m_stop || m_queued.load() != 0 || worker->m_assigned.load();
+}
+
+void* THREAD_POOL::ThreadRoutine(void* workerArg)
+{
+    WORKER* worker    = static_cast< WORKER* >(workerArg);
+    THREAD_POOL* pool = worker->m_pool;
+    currentWorker     = worker;
+    while (true)
+    {
+        bool assigned;
+        RUNNABLE_OBJ* runObj = pool->NextTask(worker, assigned);
+        if (runObj == 0)
+        {
+            if (!pool->Park(worker))
+            {
+                break;
+            }
+            continue;
+        }
+        runObj->Run();
+
+        // switch control back to the managing thread
+        if (assigned)
+        {
+            std::lock_guard< std::mutex > lock(pool->m_doneLock);
+            worker->m_busy = false;
+            pool->m_doneCond.notify_all();
+        }
+        else if (--pool->m_pending == 0)
+        {
+            std::lock_guard< std::mutex > lock(pool->m_doneLock);
+            pool->m_doneCond.notify_all();
+        }
+    }
+    return 0;
 }
 
 /* ===================================================================== */
@@ -9,28 +9,32 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include "../Utils/runnable.h"
 #include "../Utils/threadlib.h"
 
-/*!
- * Runnable object that exits the current thread.
- */
-class EXIT_THREAD_OBJ : public RUNNABLE_OBJ
-{
-  public:
-    void Run() { ExitCurrentThread(); }
-};
-
 /*!
  * Pool of threads that can be used to execute runnable objects.
+ * Objects can be run in a specific thread with Start()/Wait(), or submitted
+ * to the pool with Submit()/SubmitBatch() and awaited with WaitAll().
+ * Submitted objects are queued in per-thread deques; a thread runs the most
+ * recent object of its own deque and, when that is empty, steals the older
+ * half of the deque of another thread. Threads with nothing to do spin
+ * briefly and then sleep on a condition variable of their own, so an idle
+ * pool does not use CPU time. An object started in a thread wakes only
+ * that thread.
  * External access to this singleton must be serialized. It is guaranteed
  * if the thread pool is managed by a single (main) thread of the process.
+ * Submit() may also be called by the objects run in the pool.
  */
 class THREAD_POOL
 {
   public:
     // Constructor
-    THREAD_POOL() : m_numThreads(0) {}
+    THREAD_POOL() : m_numThreads(0), m_nextWorker(0), m_queued(0), m_pending(0), m_idle(0), m_stop(false) {}
 
     // Destructor
     ~THREAD_POOL() { TerminateAll(); }
@@ -50,41 +54,89 @@ class THREAD_POOL
     // @return runnable object assigned to the thread or NULL.
     RUNNABLE_OBJ* Wait(unsigned long tid);
 
+    // Queue the specified object to be run by any thread in the pool.
+    // @return TRUE - success, FALSE - the pool has no threads
+    bool Submit(RUNNABLE_OBJ* runObj);
+
+    // Queue the specified objects, spreading them over the threads in the pool
+    // in contiguous batches.
+    // @return TRUE - success, FALSE - the pool has no threads
+    bool SubmitBatch(RUNNABLE_OBJ* const* runObjs, unsigned long numObjs);
+
+    // Block the current thread until all submitted objects complete their function.
+    // Must not be called by an object run in the pool.
+    void WaitAll();
+
     unsigned long NumThreads() const { return m_numThreads; }
 
     // Terminate all threads in the pool.
     void TerminateAll();
 
   private:
-    unsigned long m_numThreads;
+    // Number of times an idle thread checks for new objects before it sleeps
+    static const unsigned long SPIN_COUNT = 256;
 
-    struct TLS_ELEMENT
+    struct WORKER
     {
         THREAD_HANDLE m_handle;
-        RUNNABLE_OBJ* volatile m_runObj;
-        volatile bool m_semaphore;
+        THREAD_POOL* m_pool;
+        unsigned long m_tid;
 
-        // Initialize TLS element
-        void Init()
+        // Object assigned by Start(), run by this thread only
+        RUNNABLE_OBJ* m_runObj;
+        std::atomic< bool > m_assigned; // m_runObj is waiting to be run
+        bool m_busy;                    // m_runObj is not completed, protected by m_doneLock
+
+        // Submitted objects, protected by m_lock
+        std::mutex m_lock;
+        std::deque< RUNNABLE_OBJ* > m_tasks;
+
+        // The thread sleeps on m_wakeCond, protected by THREAD_POOL::m_parkLock
+        bool m_parked;
+        std::condition_variable m_wakeCond;
+
+        WORKER(THREAD_POOL* pool, unsigned long tid)
+            : m_handle(0), m_pool(pool), m_tid(tid), m_runObj(0), m_assigned(false), m_busy(false),
+              m_parked(false)
         {
-            m_handle    = 0;
-            m_runObj    = 0;
-            m_semaphore = false;
         }
+    };
+
+    std::atomic< unsigned long > m_numThreads; // read by the threads that steal
+    WORKER* m_workers[MAXTHREADS];
+    unsigned long m_nextWorker; // round-robin target of external Submit() calls
+
+    std::atomic< long > m_queued;  // submitted objects not yet taken by a thread
+    std::atomic< long > m_pending; // submitted objects not yet completed
+    std::atomic< long > m_idle;    // threads sleeping or about to sleep
 
-        // Semaphore manipulation functions
-        void SwitchSemaphore(bool semaphoreState);
-        void WaitSemaphore(bool semaphoreState) const;
-        bool CheckSemaphore() const;
+    std::mutex m_parkLock; // protects m_stop and WORKER::m_parked
+    bool m_stop;
 
-    } m_tls[MAXTHREADS];
+    std::mutex m_doneLock; // protects WORKER::m_busy, Wait() and WaitAll() wait on m_doneCond
+    std::condition_variable m_doneCond;
 
     //Disable copy constructor and assignment operator
     THREAD_POOL(const THREAD_POOL&);
     THREAD_POOL& operator=(const THREAD_POOL&);
 
+    // Wake sleeping threads after new objects were submitted
+    void WakeUp(bool all);
+
+    // Wake the specified thread after an object was assigned to it
+    void WakeWorker(WORKER* worker);
+
+    // Return the next object to be run by the specified thread, or NULL.
+    // assigned is set if the object was assigned by Start()
+    RUNNABLE_OBJ* NextTask(WORKER* worker, bool& assigned);
+    RUNNABLE_OBJ* Steal(WORKER* thief);
+
+    // Sleep until there may be an object for the specified thread to run.
+    // @return FALSE if the pool terminates
+    bool Park(WORKER* worker);
+
     // Main routine of threads in the pool
-    static void* ThreadRoutine(void* tlsArg);
+    static void* ThreadRoutine(void* workerArg);
 };
 
 #endif //THREAD_POOL_H